@@ -0,0 +1,226 @@
+//Optimizing back end of the term generators (FlowEquationTermGenerator.cpp and SpinCorrelationTermGenerator.cpp).
+//The generated terms are nested sums of signed products, such as "+(+Pt[0][0] - Pt[0][5])*vertexProduct[12] - ...". The same sub-expressions appear many times per output component and across components,
+//which is too much for the common subexpression elimination of the compiler in expressions of this size. ExpressionOptimizer parses the terms of a set of outputs, merges identical sub-expressions
+//(also up to an overall sign), and prints every sub-expression that is used more than once as a named temporary right before its first use, so that temporaries stay live only as long as needed.
+//The number of floating-point operations is printed for the terms as generated and after the elimination.
+
+#ifndef EXPRESSIONOPTIMIZER_H
+#define EXPRESSIONOPTIMIZER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdlib.h>
+#include <ctype.h>
+
+class ExpressionOptimizer {
+public:
+    //prefix: name prefix of the temporaries, which must not clash with other variables of the function the terms are pasted into
+    explicit ExpressionOptimizer(const std::string &prefix) : prefix(prefix) {}
+
+    //Add an output statement "before + expression + after", e.g. ("addG((", "+(G00 - G11)*Pt00 ...", ")/(2*pi), DG_vec, ...);")
+    void addOutput(const std::string &before, const std::string &expression, const std::string &after) {
+        text = expression;
+        position = 0;
+        Ref ref = parseSum();
+        skipSpaces();
+        if (position != text.size()) {
+            std::cerr << "Unexpected character '" << text[position] << "' at position " << position << " of the expression " << expression.substr(0, 200) << std::endl;
+            exit(1);
+        }
+        outputs.push_back(Output{ before, after, ref });
+    }
+
+    //Print the temporaries and the output statements, each statement on its own line with the given indentation
+    void print(std::ostream &out, const std::string &indentation = "    ") {
+        std::vector<int> uses(nodes.size(), 0);
+        for (const Output &o : outputs) { countUses(o.ref.node, uses); }
+        std::vector<int> temporary(nodes.size(), -1);
+        int temporaries = 0;
+        long opsGenerated = 0, opsOptimized = 0;
+        std::vector<long> expandedOps(nodes.size(), -1);
+        std::vector<bool> counted(nodes.size(), false);
+        for (const Output &o : outputs) {
+            opsGenerated += countExpandedOps(o.ref.node, expandedOps);
+            opsOptimized += countOps(o.ref.node, counted);
+        }
+        for (const Output &o : outputs) {
+            printTemporaries(out, indentation, o.ref.node, uses, temporary, temporaries);
+            out << indentation << o.before << (o.ref.sign < 0 ? "-(" : "") << format(o.ref.node, uses, temporary) << (o.ref.sign < 0 ? ")" : "") << o.after << std::endl;
+        }
+        out << "//Floating-point operations: " << opsGenerated << " as generated, " << opsOptimized << " with " << temporaries << " common subexpressions" << std::endl;
+    }
+
+private:
+    struct Ref { int sign; int node; };
+    struct Node {
+        char kind; //'a': atom (variable, array element or number), 's': sum, 'p': product
+        std::string name;
+        std::vector<Ref> terms; //Signed summands of a sum or factors of a product (with sign +1)
+    };
+    struct Output { std::string before, after; Ref ref; };
+
+    std::string prefix;
+    std::vector<Node> nodes;
+    std::map<std::string, int> nodeIndex; //Canonical key of each node, which merges identical sub-expressions
+    std::vector<Output> outputs;
+    std::string text;
+    size_t position;
+
+    int addNode(const Node &node, const std::string &key) {
+        auto it = nodeIndex.find(key);
+        if (it != nodeIndex.end()) { return it->second; }
+        nodes.push_back(node);
+        nodeIndex[key] = nodes.size() - 1;
+        return nodes.size() - 1;
+    }
+
+    static bool lessRef(const Ref &a, const Ref &b) {
+        return a.node < b.node || (a.node == b.node && a.sign < b.sign);
+    }
+
+    //Sums are identified by their sorted summands, the first of which is made positive, so that a negated sum is a reference with sign -1 to the same node. The summands keep the order in which they are written.
+    Ref makeSum(std::vector<Ref> terms) {
+        if (terms.size() == 1) { return terms[0]; }
+        std::vector<Ref> sorted = terms;
+        std::sort(sorted.begin(), sorted.end(), lessRef);
+        int sign = sorted[0].sign;
+        std::string key = "s";
+        for (const Ref &t : sorted) { key += (t.sign * sign > 0 ? "+" : "-") + std::to_string(t.node); }
+        for (Ref &t : terms) { t.sign *= sign; }
+        return Ref{ sign, addNode(Node{ 's', "", terms }, key) };
+    }
+
+    //Products are identified by their sorted factors, and the signs of the factors are pulled out of the product
+    Ref makeProduct(std::vector<Ref> factors) {
+        if (factors.size() == 1) { return factors[0]; }
+        int sign = 1;
+        for (Ref &f : factors) {
+            sign *= f.sign;
+            f.sign = 1;
+        }
+        std::vector<Ref> sorted = factors;
+        std::sort(sorted.begin(), sorted.end(), lessRef);
+        std::string key = "p";
+        for (const Ref &f : sorted) { key += "*" + std::to_string(f.node); }
+        return Ref{ sign, addNode(Node{ 'p', "", factors }, key) };
+    }
+
+    void skipSpaces() {
+        while (position < text.size() && text[position] == ' ') { position++; }
+    }
+
+    Ref parseSum() {
+        std::vector<Ref> terms;
+        skipSpaces();
+        while (position < text.size() && text[position] != ')') {
+            int sign = 1;
+            if (text[position] == '+' || text[position] == '-') {
+                sign = (text[position] == '-') ? -1 : 1;
+                position++;
+            }
+            else if (!terms.empty()) {
+                break;
+            }
+            Ref term = parseProduct();
+            term.sign *= sign;
+            terms.push_back(term);
+            skipSpaces();
+        }
+        if (terms.empty()) {
+            std::cerr << "Empty sum at position " << position << std::endl;
+            exit(1);
+        }
+        return makeSum(terms);
+    }
+
+    Ref parseProduct() {
+        std::vector<Ref> factors;
+        factors.push_back(parseFactor());
+        skipSpaces();
+        while (position < text.size() && text[position] == '*') {
+            position++;
+            factors.push_back(parseFactor());
+            skipSpaces();
+        }
+        return makeProduct(factors);
+    }
+
+    Ref parseFactor() {
+        skipSpaces();
+        if (position < text.size() && text[position] == '(') {
+            position++;
+            Ref sum = parseSum();
+            if (position >= text.size() || text[position] != ')') {
+                std::cerr << "Missing ')' at position " << position << std::endl;
+                exit(1);
+            }
+            position++;
+            return sum;
+        }
+        //Atoms are names or numbers, with array indices that are kept as written
+        size_t start = position;
+        while (position < text.size() && (isalnum(text[position]) || text[position] == '_' || text[position] == '.')) { position++; }
+        while (position < text.size() && text[position] == '[') {
+            while (position < text.size() && text[position] != ']') { position++; }
+            position++;
+        }
+        if (position == start) {
+            std::cerr << "Unexpected character '" << text[position] << "' at position " << position << std::endl;
+            exit(1);
+        }
+        std::string name = text.substr(start, position - start);
+        return Ref{ 1, addNode(Node{ 'a', name, {} }, "a" + name) };
+    }
+
+    void countUses(int node, std::vector<int> &uses) {
+        if (uses[node]++ > 0) { return; }
+        for (const Ref &t : nodes[node].terms) { countUses(t.node, uses); }
+    }
+
+    //Operations of the terms as generated, where every use of a sub-expression is evaluated again
+    long countExpandedOps(int node, std::vector<long> &expandedOps) {
+        if (expandedOps[node] >= 0) { return expandedOps[node]; }
+        long ops = nodes[node].terms.empty() ? 0 : nodes[node].terms.size() - 1;
+        for (const Ref &t : nodes[node].terms) { ops += countExpandedOps(t.node, expandedOps); }
+        return expandedOps[node] = ops;
+    }
+
+    //Operations after the elimination, where every sub-expression is evaluated once
+    long countOps(int node, std::vector<bool> &counted) {
+        if (counted[node]) { return 0; }
+        counted[node] = true;
+        long ops = nodes[node].terms.empty() ? 0 : nodes[node].terms.size() - 1;
+        for (const Ref &t : nodes[node].terms) { ops += countOps(t.node, counted); }
+        return ops;
+    }
+
+    //Print the temporaries that the node needs and that are not printed yet, in the order of their first use
+    void printTemporaries(std::ostream &out, const std::string &indentation, int node, const std::vector<int> &uses, std::vector<int> &temporary, int &temporaries) {
+        if (nodes[node].kind == 'a' || temporary[node] >= 0) { return; }
+        for (const Ref &t : nodes[node].terms) { printTemporaries(out, indentation, t.node, uses, temporary, temporaries); }
+        if (uses[node] > 1) {
+            out << indentation << "double " << prefix << temporaries << " = " << format(node, uses, temporary, false) << ";" << std::endl;
+            temporary[node] = temporaries++;
+        }
+    }
+
+    std::string format(int node, const std::vector<int> &uses, const std::vector<int> &temporary, bool useTemporary = true) {
+        const Node &n = nodes[node];
+        if (n.kind == 'a') { return n.name; }
+        if (useTemporary && temporary[node] >= 0) { return prefix + std::to_string(temporary[node]); }
+        std::string s;
+        for (size_t i = 0; i < n.terms.size(); ++i) {
+            const Ref &t = n.terms[i];
+            bool parentheses = (nodes[t.node].kind == 's' && temporary[t.node] < 0);
+            if (n.kind == 's') { s += (i == 0) ? (t.sign < 0 ? "-" : "") : (t.sign < 0 ? " - " : " + "); }
+            else if (i > 0) { s += " * "; }
+            s += (parentheses ? "(" : "") + format(t.node, uses, temporary) + (parentheses ? ")" : "");
+        }
+        return s;
+    }
+};
+
+#endif
@@ -14,6 +14,7 @@
 #include <algorithm>
 #include <list>
 #include<vector>
+#include "ExpressionOptimizer.h"
 
 using namespace std;
 
@@ -23,6 +24,51 @@ bool U1Symmetric = false;
 
 int TermCounter[5] = {0,0,0,0,0};
 
+//Decide whether the flow equation terms are printed as sparse spin tensors, which are contracted by the table-driven kernels of the PFFRG code, or as expressions (the previous output format)
+bool emitSpinTensors = true;
+//Decide whether shared sub-expressions of the printed expressions are factored into temporaries (see ExpressionOptimizer.h)
+bool optimizeExpressions = true;
+
+//Sparse spin tensors of the two-particle vertex flow equation terms: SpinTensor[term][o][m][p] is the coefficient of the product of the vertex product m and the propagator bubble component p in the output spin component o = 4*mu+nu.
+//The vertex product m = 16*x + y is the product of the spin components x and y of the two vertices of a term (for the RPA term, the components 4*mu+b and 4*c+nu of the site summation vertexProduct).
+//Terms: 0: s channel, 1: RPA term of the t channel, 2 and 3: t-channel terms with the vertices (R, R0f) and (R0i, R), 4: u channel
+int SpinTensor[5][16][256][16];
+bool imaginarySpinTerms = false;
+
+//Add a term with the prefactor "prefactor" (which is +-1 for all terms of the flow equations) to a spin tensor
+void addSpinTerm(int term, int o, int x, int y, int p, complex<int> prefactor){
+    if(prefactor.imag() != 0){
+        imaginarySpinTerms = true;
+        return;
+    }
+    SpinTensor[term][o][16*x+y][p] += prefactor.real();
+}
+
+//Print a spin tensor as C++ array of packed entries o + 16*m + 4096*p + 65536*(coefficient < 0)
+void printSpinTensor(int term, string name){
+    int count = 0;
+    string entries;
+    for(int o=0;o<16;o++){
+        for(int m=0;m<256;m++){
+            for(int p=0;p<16;p++){
+                int c = SpinTensor[term][o][m][p];
+                if(c == 0){
+                    continue;
+                }
+                if(abs(c) != 1){
+                    cerr << "Coefficient " << c << " in spin tensor " << name << " cannot be packed" << endl;
+                    exit(1);
+                }
+                entries += to_string(o + 16*m + 4096*p + 65536*(c < 0)) + ",";
+                if(++count % 24 == 0){
+                    entries += "\n    ";
+                }
+            }
+        }
+    }
+    cout << "const int " << name << "[" << count << "] = {" << endl << "    " << entries << endl << "};" << endl;
+}
+
 complex<int> iu(0,1);
 
 //The $\bm{\beta}_{a}$ matrices are defined by the equation
@@ -131,6 +177,7 @@ int main(int argc, char *argv[])
                                                     +prefactorSymbol+"Ch1A1_"+to_string(a)+to_string(b)+"*Ch1A2_"+to_string(c)+to_string(d)+"TL";
 
                                             Channel[0][mu][nu] += tempTermCodeFormatShort;
+                                            addSpinTerm(0, 4*mu+nu, 4*a+b, 4*c+d, 4*prFactor*prA+prFactor*prB, prefactor);
                                             TermCounter[0]++;
                                             //Channel[0][mu][nu] += tempTermCodeFormatTwoLoop;
                                             //}
@@ -211,6 +258,8 @@ int main(int argc, char *argv[])
                                 TermCounter[1]++;
                                 //Channel[5+prA*4+prB][mu][nu] += optimizedTerms;//tempTermCodeFormatShort;
                                 Channel[5+b*4+c][mu][nu] +=  PropagatorTerms;//tempTermCodeFormatShort;
+                                //The prefactor symbols of the RPA term carry an extra minus sign
+                                addSpinTerm(1, 4*mu+nu, 4*mu+b, 4*c+nu, 4*prFactor*prA+prFactor*prB, -prefactor);
                                 //Channel[1][mu][nu] += tempTermCodeFormatTwoLoop;
                                 //}
                             }
@@ -283,6 +332,7 @@ int main(int argc, char *argv[])
                                             string tempTermCodeFormatTwoLoopShort = prefactorSymbol+"Ch3A1_"+to_string(mu)+to_string(b)+"TL*Ch3A2_"+to_string(c)+to_string(d)
                                                     +prefactorSymbol+"Ch3A1_"+to_string(mu)+to_string(b)+"*Ch3A2_"+to_string(c)+to_string(d)+"TL";
                                             Channel[2][mu][nu] += tempTermCodeFormatShort;
+                                            addSpinTerm(2, 4*mu+nu, 4*mu+b, 4*c+d, 4*prFactor*prA+prFactor*prB, prefactor);
                                             //Channel[2][mu][nu] += tempTermCodeFormatTwoLoop;
                                             //}
                                             TermCounter[2]++;
@@ -356,6 +406,7 @@ int main(int argc, char *argv[])
                                             string tempTermCodeFormatTwoLoopShort = prefactorSymbol+"Ch4A1_"+to_string(a)+to_string(b)+"TL*Ch4A2_"+to_string(c)+to_string(nu)
                                                     +prefactorSymbol+"Ch4A1_"+to_string(a)+to_string(b)+"*Ch4A2_"+to_string(c)+to_string(nu)+"TL";
                                             Channel[3][mu][nu] += tempTermCodeFormatShort;
+                                            addSpinTerm(3, 4*mu+nu, 4*a+b, 4*c+nu, 4*prFactor*prA+prFactor*prB, prefactor);
                                             //Channel[3][mu][nu] += tempTermCodeFormatTwoLoop;
                                             //}
                                             TermCounter[3]++;
@@ -435,6 +486,7 @@ int main(int argc, char *argv[])
                                             string tempTermCodeFormatTwoLoopShort = prefactorSymbol+"Ch5A1_"+to_string(b)+to_string(a)+"TL*Ch5A2_"+to_string(d)+to_string(c)
                                                     +prefactorSymbol+"Ch5A1_"+to_string(b)+to_string(a)+"*Ch5A2_"+to_string(d)+to_string(c)+"TL";
                                             Channel[4][mu][nu] += tempTermCodeFormatShort;
+                                            addSpinTerm(4, 4*mu+nu, 4*b+a, 4*d+c, 4*prFactor*prA+prFactor*prB, prefactor);
                                             //Channel[4][mu][nu] += tempTermCodeFormatTwoLoop;
                                             //}
                                             TermCounter[4]++;
@@ -580,10 +632,33 @@ return 0;*/
 
 
     //Print out flow equation terms
+    if(emitSpinTensors){
+        if(imaginarySpinTerms){
+            cerr << "The flow equation terms have imaginary prefactors and cannot be printed as spin tensors" << endl;
+            return 1;
+        }
+        cout << "//Spin tensors of the two-particle vertex flow equation terms (generated by FlowEquationTermGenerator.cpp" << (U1Symmetric ? " with U1Symmetric = true" : "") << ")" << endl;
+        printSpinTensor(0, "sChannelSpinTerms");
+        printSpinTensor(1, "tChannelRPASpinTerms");
+        printSpinTensor(2, "tChannelSpinTermsR0f");
+        printSpinTensor(3, "tChannelSpinTermsR0i");
+        printSpinTensor(4, "uChannelSpinTerms");
+        cout << endl;
+        for(int i=0; i<5;i++){
+            cout << "//Number of terms in channel " << i << ": " << TermCounter[i] << endl;
+        }
+        return 0;
+    }
+
+    //Expressions with imaginary prefactors cannot be parsed by the optimizer
+    if(imaginarySpinTerms){
+        optimizeExpressions = false;
+    }
 
     //s-channel terms
     int channelIndex=0;
     cout << "Channel no "+to_string(channelIndex)+": " << endl;
+    ExpressionOptimizer sChannelTerms("sTerm");
     for(int mu=0;mu<4;mu++){
         for(int nu=0;nu<4;nu++){
             if(U1Symmetric){
@@ -592,29 +667,43 @@ return 0;*/
                 }
             }
             //if(mu==nu){
-            cout << "addG(( "
-                 << Channel[channelIndex][mu][nu]
-                    << ")/(2*pi) , DG_vec,1,"+to_string(mu)+","+to_string(nu)+", R, ns,nt,nu);"
-                    << endl;
+            string after = ")/(2*pi) , DG_vec,1,"+to_string(mu)+","+to_string(nu)+", R, ns,nt,nu);";
+            if(optimizeExpressions){
+                sChannelTerms.addOutput("addG(( ", Channel[channelIndex][mu][nu], after);
+            }else{
+                cout << "addG(( " << Channel[channelIndex][mu][nu] << after << endl;
+            }
             //}
         }
     }
+    if(optimizeExpressions){
+        sChannelTerms.print(cout);
+    }
     cout << endl;
 
     //RPA summations
     channelIndex=1;
     //Belongs to the RPA section
     //Print out expressions for t(mu)(nu)
+    ExpressionOptimizer rpaTerms("rpaTerm"+to_string(subl)+"_");
     for(int mu=0;mu<4;mu++){
         for(int nu=0;nu<4;nu++){
-            cout << "double t"+to_string(mu) + to_string(nu) + "i" + to_string(subl) + " = ";
+            string before = "double t"+to_string(mu) + to_string(nu) + "i" + to_string(subl) + " = ";
+            string terms;
             for(int b=0;b<4;b++){
                 for(int c=0;c<4;c++){
                     //Important: Note the "shift" summand needs to dissapear for subl=0 and becomes "shift2" for subl=2
-                    cout << " +("+ Channel[5+b*4+c][mu][nu] + ")*vertexProduct[shift+"+ to_string(64*mu+16*b+4*c+nu) + "]";
+                    terms += " +("+ Channel[5+b*4+c][mu][nu] + ")*vertexProduct[shift+"+ to_string(64*mu+16*b+4*c+nu) + "]";
                 }}
-            cout << ";"<<endl;
+            if(optimizeExpressions){
+                rpaTerms.addOutput(before, terms, ";");
+            }else{
+                cout << before << terms << ";" << endl;
+            }
         }}
+    if(optimizeExpressions){
+        rpaTerms.print(cout);
+    }
     cout << endl;
 
     //Set all t(mu)(nu) to zero
@@ -633,6 +722,7 @@ return 0;*/
     //t-channel terms
     channelIndex=2;
     cout << "Channel no "+to_string(channelIndex)+": " << endl;
+    ExpressionOptimizer tChannelTerms("tTerm");
     for(int mu=0;mu<4;mu++){
         for(int nu=0;nu<4;nu++){
             if(U1Symmetric){
@@ -641,19 +731,26 @@ return 0;*/
                 }
             }
             //if(mu==nu){
-            cout << "addG(( 2*t"+to_string(mu)+to_string(nu)+" "
-                 << Channel[2][mu][nu] << Channel[3][mu][nu]
-                    << ")/(2*pi) , DG_vec,1,"+to_string(mu)+","+to_string(nu)+", R, ns,nt,nu);"
-                    << endl;
+            string terms = " 2*t"+to_string(mu)+to_string(nu)+" "+Channel[2][mu][nu]+Channel[3][mu][nu];
+            string after = ")/(2*pi) , DG_vec,1,"+to_string(mu)+","+to_string(nu)+", R, ns,nt,nu);";
+            if(optimizeExpressions){
+                tChannelTerms.addOutput("addG((", terms, after);
+            }else{
+                cout << "addG((" << terms << after << endl;
+            }
             //}
         }
     }
+    if(optimizeExpressions){
+        tChannelTerms.print(cout);
+    }
     cout << endl;
 
 
     //u-channel terms
     channelIndex=4;
     cout << "Channel no "+to_string(channelIndex)+": " << endl;
+    ExpressionOptimizer uChannelTerms("uTerm");
     for(int mu=0;mu<4;mu++){
         for(int nu=0;nu<4;nu++){
             if(U1Symmetric){
@@ -662,12 +759,18 @@ return 0;*/
                 }
             }
             //if(mu==nu){
-            cout << "addG(( " << Channel[channelIndex][mu][nu]
-                    << ")/(2*pi) , DG_vec,1,"+to_string(mu)+","+to_string(nu)+", R, ns,nt,nu);"
-                    << endl;
+            string after = ")/(2*pi) , DG_vec,1,"+to_string(mu)+","+to_string(nu)+", R, ns,nt,nu);";
+            if(optimizeExpressions){
+                uChannelTerms.addOutput("addG(( ", Channel[channelIndex][mu][nu], after);
+            }else{
+                cout << "addG(( " << Channel[channelIndex][mu][nu] << after << endl;
+            }
             //}
         }
     }
+    if(optimizeExpressions){
+        uChannelTerms.print(cout);
+    }
     cout << endl;
 
 
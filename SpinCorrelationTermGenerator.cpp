@@ -17,6 +17,7 @@
 #include <algorithm>
 #include <list>
 #include<vector>
+#include "ExpressionOptimizer.h"
 
 using namespace std;
 
@@ -33,6 +34,9 @@ complex<int> beta[4][4][4] = {{{1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1}},
 int main(int argc, char *argv[])
 {
     bool TermsSimplified = true;
+    //Factor shared sub-expressions of the simplified terms into temporaries (see ExpressionOptimizer.h)
+    bool optimizeExpressions = true;
+    bool imaginaryTerms = false;
     //Specify symmetry properties of the considered model
     bool U1Symmetric = true;
     bool TRSymmetric = true;
@@ -66,8 +70,8 @@ int main(int argc, char *argv[])
             if(b>0 && TRSymmetric){continue;}
 
             if(TermsSimplified){
-                tempTermA2 += "+gb2_"+to_string(b)+"*(";
-                tempTermB2 += "+gb2_"+to_string(b)+"*(";
+                tempTermA2 += "+gb"+to_string(b)+"*(";
+                tempTermB2 += "+gb"+to_string(b)+"*(";
             }else{
                 tempTermA2 += "+iGLam("+to_string(b/3)+",w2,G_vec)*(";
                 tempTermB2 += "+iGLam("+to_string(b/3)+",w2,G_vec)*(";
@@ -79,8 +83,8 @@ int main(int argc, char *argv[])
                 if(c>0 && TRSymmetric){continue;}
 
                 if(TermsSimplified){
-                    tempTermA3 += "+ga2_"+to_string(c)+"*(";
-                    tempTermB3 += "+ga2_"+to_string(c)+"*(";
+                    tempTermA3 += "+ga"+to_string(c)+"*(";
+                    tempTermB3 += "+ga"+to_string(c)+"*(";
                 }else{
                     tempTermA3 += "+iGLam("+to_string(c/3)+",w,G_vec)*(";
                     tempTermB3 += "+iGLam("+to_string(c/3)+",w,G_vec)*(";
@@ -140,8 +144,10 @@ int main(int argc, char *argv[])
                                                     prefactorSymbol="-";
                                                 }else if(f12 == iu){
                                                     prefactorSymbol="+i";
+                                                    imaginaryTerms = true;
                                                 }else if(f12 == -iu){
                                                     prefactorSymbol="-i";
+                                                    imaginaryTerms = true;
                                                 }else if(f12 == 0){
                                                     continue;
                                                 }
@@ -173,8 +179,10 @@ int main(int argc, char *argv[])
                                                             prefactorSymbol="-";
                                                         }else if(f3 == iu){
                                                             prefactorSymbol="+i";
+                                                            imaginaryTerms = true;
                                                         }else if(f3 == -iu){
                                                             prefactorSymbol="-i";
+                                                            imaginaryTerms = true;
                                                         }else if(f3 == 0){
                                                             continue;
                                                         }
@@ -217,8 +225,20 @@ int main(int argc, char *argv[])
     termsB += tempTermB1+")";
 
     //Give out all terms
-    cout << "First terms(includes summation over lattice sites): " << endl << termsA << endl;
-    cout << "Second terms: " << endl << termsB << endl;
+    //The optimizer only parses real terms with the simplified propagator names; the two sets of terms are optimized separately, since their vertices G are evaluated at different lattice sites
+    if(optimizeExpressions && TermsSimplified && !imaginaryTerms){
+        cout << "First terms(includes summation over lattice sites): " << endl;
+        ExpressionOptimizer firstTerms("chiTermA");
+        firstTerms.addOutput("double chiTermsA = ", termsA, ";");
+        firstTerms.print(cout);
+        cout << "Second terms: " << endl;
+        ExpressionOptimizer secondTerms("chiTermB");
+        secondTerms.addOutput("double chiTermsB = ", termsB, ";");
+        secondTerms.print(cout);
+    }else{
+        cout << "First terms(includes summation over lattice sites): " << endl << termsA << endl;
+        cout << "Second terms: " << endl << termsB << endl;
+    }
 
 
     //Generate terms for the spin correlation that are quadratic in propagators
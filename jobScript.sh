@@ -14,5 +14,5 @@
 export OMP_NUM_THREADS=128
 
 # run your program...
-./PFFRG "$1"
+./PFFRG "$@"
 